@@ -0,0 +1,90 @@
+# alloctest.tcl --
+#
+#	Check that repeated clipssh calls do not accumulate memory: after a
+#	warm up, run many calls and verify that neither the resident size of
+#	the process nor the number of blocks allocated by malloc grows.
+#
+# Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+#
+# This file is part of the Clipssh project.  Clipssh is distributed under the
+# Tcl license.  The terms of the license are described in the file
+# "license.terms" which should be included with this distribution.
+#
+# Usage: tclsh alloctest.tcl ?-option value ...?
+#
+#   -calls n		Number of calls measured (default 1000000).
+#   -warmup n		Number of calls made before measuring (default 10000).
+#   -batch n		Calls between visits to the event loop, which fire
+#			or release the pending timers (default 1000).
+#   -delay ms		The -delay passed to clipssh (default 0).
+#   -maxblocks n	Allowed growth in malloc blocks (default 200).
+#   -maxrss kB		Allowed growth in resident size (default 1024).
+#
+# Every call copies a different clip of the same length, so that each goes
+# through the whole clear and promise cycle rather than refreshing the clip
+# which is pending.  The blocks in use are counted with heap(1), which
+# reports the live blocks in every malloc zone of the process; if it is not
+# available only the resident size is checked.  The process exits with
+# status 1 if either grew by more than allowed.
+
+package require clipssh
+source [file join [file dirname [info script]] common.tcl]
+
+getopts {
+    -calls 1000000
+    -warmup 10000
+    -batch 1000
+    -delay 0
+    -maxblocks 200
+    -maxrss 1024
+}
+
+# The number of blocks malloc has handed out and not had back, or "-" if
+# heap(1) cannot tell.
+
+proc blocks {} {
+    if {[catch {exec heap [pid]} output]
+	    || ![regexp {All zones:\s*([0-9,]+) nodes} $output -> count]} {
+	return -
+    }
+    return [string map {, {}} $count]
+}
+
+proc calls {first n} {
+    global opts
+    for {set i $first} {$i < $first + $n} {incr i} {
+	clipssh -delay $opts(-delay) [format "alloctest-%09d" $i]
+	if {$i % $opts(-batch) == 0} {
+	    update
+	}
+    }
+    update
+}
+
+calls 0 $opts(-warmup)
+set startRss [rss]
+set startBlocks [blocks]
+set start [clock microseconds]
+calls $opts(-warmup) $opts(-calls)
+set elapsed [expr {[clock microseconds] - $start}]
+set endRss [rss]
+set endBlocks [blocks]
+
+set failed 0
+puts [format "%d calls, %.2f us per call" $opts(-calls) \
+	[expr {double($elapsed) / $opts(-calls)}]]
+puts "rss (kB):      $startRss -> $endRss"
+if {$endRss - $startRss > $opts(-maxrss)} {
+    puts "FAILED: resident size grew by [expr {$endRss - $startRss}] kB"
+    set failed 1
+}
+if {$startBlocks eq "-" || $endBlocks eq "-"} {
+    puts "malloc blocks: not available"
+} else {
+    puts "malloc blocks: $startBlocks -> $endBlocks"
+    if {$endBlocks - $startBlocks > $opts(-maxblocks)} {
+	puts "FAILED: [expr {$endBlocks - $startBlocks}] more blocks in use"
+	set failed 1
+    }
+}
+exit $failed
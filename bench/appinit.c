@@ -0,0 +1,42 @@
+/*
+ * appinit.c --
+ *
+ *	A tclsh with a static build of the Clipssh package linked in, for
+ *	comparing the startup cost of static and shared builds.  See
+ *	startup.tcl.
+ *
+ * Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+ *
+ * This file is part of the Clipssh project.  Clipssh is distributed under the
+ * Tcl license.  The terms of the license are described in the file
+ * "license.terms" which should be included with this distribution.
+ */
+
+#include "clipssh.h"
+
+static int
+AppInit(
+    Tcl_Interp *interp)
+{
+    if (Tcl_Init(interp) == TCL_ERROR) {
+	return TCL_ERROR;
+    }
+    return Clipssh_StaticRegister(interp);
+}
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    Tcl_Main(argc, argv, AppInit);
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * End:
+ */
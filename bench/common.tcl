@@ -0,0 +1,50 @@
+# common.tcl --
+#
+#	Procedures shared by the benchmark scripts in this directory, which
+#	load it with
+#
+#	    source [file join [file dirname [info script]] common.tcl]
+#
+# Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+#
+# This file is part of the Clipssh project.  Clipssh is distributed under the
+# Tcl license.  The terms of the license are described in the file
+# "license.terms" which should be included with this distribution.
+
+# Fill the global array opts with the defaults, a list of options and
+# values, and then with the options given on the command line.  An unknown
+# option ends the script with an error message.
+
+proc getopts {defaults} {
+    global opts argv
+    array set opts $defaults
+    if {[llength $argv] % 2 != 0} {
+	puts stderr "missing value for option \"[lindex $argv end]\""
+	exit 1
+    }
+    foreach {option value} $argv {
+	if {![info exists opts($option)]} {
+	    puts stderr "unknown option \"$option\": must be one of\
+		    [join [lsort [array names opts]] {, }]"
+	    exit 1
+	}
+	set opts($option) $value
+    }
+}
+
+# The resident size of this process in kB.
+
+proc rss {} {
+    return [string trim [exec ps -o rss= -p [pid]]]
+}
+
+# The value below which a fraction p of the values lie, or "-" if there are
+# none.
+
+proc percentile {values p} {
+    if {[llength $values] == 0} {
+	return -
+    }
+    set values [lsort -real $values]
+    return [lindex $values [expr {int($p * ([llength $values] - 1))}]]
+}
@@ -0,0 +1,152 @@
+# leakbench.tcl --
+#
+#	Measure, for a range of -delay settings, how often simulated clipboard
+#	managers manage to archive a clip copied with clipssh, and how long it
+#	takes from the copy until a paste can receive the clip.
+#
+# Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+#
+# This file is part of the Clipssh project.  Clipssh is distributed under the
+# Tcl license.  The terms of the license are described in the file
+# "license.terms" which should be included with this distribution.
+#
+# Usage: tclsh leakbench.tcl ?-option value ...?
+#
+#   -sim path		The managersim executable (default ./managersim).
+#   -managers list	Managers to run during each trial, as a list of
+#			strategy:interval_ms pairs (default
+#			{changecount:500 changecount:250 eager:500}).
+#   -delays list	The -delay values to try, in milliseconds (default
+#			{0 50 100 250 500 750 1000}).
+#   -trials n		Number of trials for each delay (default 20).
+#   -poll ms		Interval between paste attempts (default 20).
+#   -timeout ms		How long after the delay to keep trying to paste
+#			(default 2000).
+#
+# Each trial starts the managers and copies a fresh secret with clipssh at a
+# random phase relative to their polling.  From the moment of the copy it
+# pastes with "managersim paste" every -poll milliseconds, as an impatient
+# user would, until a paste receives the secret.  The latency reported is
+# the time from the clipssh call until that paste finished, which is what
+# the delay costs the user.  The trial then checks whether any manager read
+# the secret.  The run loop must keep running while the simulated processes
+# read the pasteboard, so all of them are driven through fileevents rather
+# than exec.
+
+package require clipssh
+source [file join [file dirname [info script]] common.tcl]
+
+getopts {
+    -sim ./managersim
+    -managers {changecount:500 changecount:250 eager:500}
+    -delays {0 50 100 250 500 750 1000}
+    -trials 20
+    -poll 20
+    -timeout 2000
+}
+
+# Start a simulated process and collect its output lines in lines($chan).
+# The variable done($chan) is set when it exits.
+
+proc start {args} {
+    global lines done
+    set chan [open |[list $::opts(-sim) {*}$args] r]
+    fconfigure $chan -blocking 0 -buffering line
+    set lines($chan) {}
+    unset -nocomplain done($chan)
+    fileevent $chan readable [list collect $chan]
+    return $chan
+}
+
+proc collect {chan} {
+    global lines done
+    while {[gets $chan line] >= 0} {
+	lappend lines($chan) $line
+    }
+    if {[eof $chan]} {
+	catch {close $chan}
+	set done($chan) [clock microseconds]
+    }
+}
+
+proc wait {ms} {
+    after $ms [list set ::waited 1]
+    vwait ::waited
+}
+
+proc trial {delay secret} {
+    global opts lines done
+    set longest 0
+    foreach manager $opts(-managers) {
+	lassign [split $manager :] strategy interval
+	set longest [expr {max($longest, $interval)}]
+    }
+    set duration [expr {$longest + $delay + $opts(-timeout) + 1000}]
+    set managers {}
+    foreach manager $opts(-managers) {
+	lassign [split $manager :] strategy interval
+	lappend managers [start watch $strategy $interval $duration]
+    }
+
+    # Copy at a random phase of the managers' polling.
+    wait [expr {int(rand() * $longest)}]
+    set start [clock microseconds]
+    clipssh -delay $delay $secret
+
+    # Paste until the secret arrives, or give up.
+    set deadline [expr {$start + ($delay + $opts(-timeout)) * 1000}]
+    set pasted 0
+    set latency {}
+    while {[clock microseconds] < $deadline} {
+	set paster [start paste]
+	while {![info exists done($paster)]} {
+	    vwait done($paster)
+	}
+	if {[lindex $lines($paster) 0] eq $secret} {
+	    set pasted 1
+	    set latency [expr {($done($paster) - $start) / 1000.0}]
+	    break
+	}
+	wait $opts(-poll)
+    }
+
+    foreach chan $managers {
+	while {![info exists done($chan)]} {
+	    vwait done($chan)
+	}
+    }
+    set leaked 0
+    foreach chan $managers {
+	if {$secret in $lines($chan)} {
+	    set leaked 1
+	}
+    }
+    return [list $leaked $pasted $latency]
+}
+
+proc ms {value} {
+    if {$value eq "-"} {
+	return $value
+    }
+    return [format %.1f $value]
+}
+
+puts [format "%8s %8s %8s %12s %12s" delay leak% pasted% p50_ms p95_ms]
+foreach delay $opts(-delays) {
+    set leaks 0
+    set pastes 0
+    set latencies {}
+    for {set i 0} {$i < $opts(-trials)} {incr i} {
+	set secret "clipssh-[clock microseconds]-[expr {int(rand() * 1e9)}]"
+	lassign [trial $delay $secret] leaked pasted latency
+	incr leaks $leaked
+	incr pastes $pasted
+	if {$pasted} {
+	    lappend latencies $latency
+	}
+    }
+    puts [format "%8d %8.1f %8.1f %12s %12s" $delay \
+	    [expr {100.0 * $leaks / $opts(-trials)}] \
+	    [expr {100.0 * $pastes / $opts(-trials)}] \
+	    [ms [percentile $latencies 0.5]] [ms [percentile $latencies 0.95]]]
+}
@@ -0,0 +1,109 @@
+/*
+ * managersim.m --
+ *
+ *	A simulated clipboard manager, and a simulated paste, for measuring
+ *	how well clipssh hides its clips.  See leakbench.tcl.
+ *
+ * Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+ *
+ * This file is part of the Clipssh project.  Clipssh is distributed under the
+ * Tcl license.  The terms of the license are described in the file
+ * "license.terms" which should be included with this distribution.
+ */
+
+// Usage:
+//
+//   managersim watch strategy interval_ms duration_ms
+//	Poll the general pasteboard every interval_ms milliseconds, for
+//	duration_ms milliseconds, the way a clipboard manager does.  Every
+//	string which is read is written to stdout, one per line, so the
+//	caller can tell whether a clip was archived.  The strategies are:
+//	  changecount  read the string whenever the changeCount has changed,
+//		       as most clipboard managers do;
+//	  eager	       read the string on every poll if the pasteboard offers
+//		       one, as a manager which inspects the types would.
+//
+//   managersim paste
+//	Read the string once, as an application does for a paste, and write
+//	it to stdout followed by the time taken in microseconds.
+
+#import <Cocoa/Cocoa.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// Strings are written on a single line, so that a clip containing a newline
+// cannot be mistaken for two reads.
+
+static void report(NSString *string) {
+    NSString *line = [string stringByReplacingOccurrencesOfString:@"\n"
+						      withString:@"\\n"];
+    printf("%s\n", line.UTF8String);
+    fflush(stdout);
+}
+
+static int watch(const char *strategy, int interval, int duration) {
+    NSPasteboard *pb = [NSPasteboard generalPasteboard];
+    NSInteger changeCount = pb.changeCount;
+    BOOL eager = strcmp(strategy, "eager") == 0;
+    uint64_t end = now() + (uint64_t) duration * 1000000;
+
+    if (!eager && strcmp(strategy, "changecount") != 0) {
+	fprintf(stderr, "unknown strategy \"%s\"\n", strategy);
+	return 1;
+    }
+    while (now() < end) {
+	@autoreleasepool {
+	    BOOL changed = pb.changeCount != changeCount;
+	    changeCount = pb.changeCount;
+	    if (changed || (eager && [pb.types containsObject:
+					      NSPasteboardTypeString])) {
+		NSString *string = [pb stringForType:NSPasteboardTypeString];
+		if (string) {
+		    report(string);
+		}
+	    }
+	}
+	usleep(interval * 1000);
+    }
+    return 0;
+}
+
+static int paste(void) {
+    @autoreleasepool {
+	uint64_t start = now();
+	NSString *string = [[NSPasteboard generalPasteboard]
+			       stringForType:NSPasteboardTypeString];
+	uint64_t elapsed = now() - start;
+	report(string ? string : @"");
+	printf("%llu\n", (unsigned long long) elapsed / 1000);
+    }
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc == 5 && strcmp(argv[1], "watch") == 0) {
+	return watch(argv[2], atoi(argv[3]), atoi(argv[4]));
+    }
+    if (argc == 2 && strcmp(argv[1], "paste") == 0) {
+	return paste();
+    }
+    fprintf(stderr, "usage: %s watch changecount|eager interval_ms "
+	    "duration_ms\n       %s paste\n", argv[0], argv[0]);
+    return 2;
+}
+
+/*
+ * Local Variables:
+ * mode: objc
+ * c-basic-offset: 4
+ * fill-column: 78
+ * End:
+ */
@@ -0,0 +1,337 @@
+# soak.tcl --
+#
+#	A long running soak test of clipssh.  Several interpreters fire
+#	clipssh at a steady rate while simulated applications paste at the
+#	same time, and the test keeps track of throughput, latency, memory
+#	and pastes which were lost or delivered twice.  Other threads may
+#	load the package at the same time and deliver clips with -exec.
+#
+# Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+#
+# This file is part of the Clipssh project.  Clipssh is distributed under the
+# Tcl license.  The terms of the license are described in the file
+# "license.terms" which should be included with this distribution.
+#
+# Usage: tclsh soak.tcl ?-option value ...?
+#
+#   -sim path		The managersim executable (default ./managersim).
+#   -duration secs	How long to run (default 3600).
+#   -interps n		Number of interpreters firing clipssh (default 4).
+#   -rate n		Calls per second made by each interpreter
+#			(default 2).
+#   -requestors n	Number of simulated applications pasting
+#			(default 2).
+#   -pasterate n	Pastes per second made by each of them (default 4).
+#   -delay ms		The -delay passed to clipssh (default 20).
+#   -linger ms		The -linger passed to clipssh (default 0).
+#   -report secs	Interval between reports (default 60).
+#   -threads n		Number of threads which also load the package and
+#			fire clipssh -exec at the same rate (default 0).
+#
+# The interpreters which use the pasteboard live in the main thread.  The
+# pasteboard backend belongs to the main thread's run loop, as AppKit
+# requires, and clipssh refuses to use the clipboard from any other thread.
+# Each of the -threads threads checks that it is refused, and then delivers
+# clips to "cat" with -exec, which does work in any thread.  A delivery is
+# counted as lost if neither its notification nor an error arrived.
+#
+# There is only one pasteboard, so each call replaces the clip of the
+# previous one, from whichever interpreter.  A clip which no paste received
+# before the next call is counted as replaced.  When the calls of all the
+# interpreters together come closer than the delay, as in "-rate 50", most
+# clips are replaced before they are ever offered.  The test then runs in
+# high rate mode, which stresses clipssh rather than the pastes, and most
+# pastes are expected to find the pasteboard empty.
+#
+# A clip is counted as lost if a paste received it but no -command
+# notification followed, or the reverse, within a grace period of five
+# seconds.  It is counted as duplicated if a paste which started after the
+# linger time had passed received it again.  A paste which starts during the
+# linger time is served by the pasteboard itself, without clipssh knowing,
+# so a second read then is only counted.  Pastes which find the pasteboard
+# empty, because no clip was pending, are counted too.  The process exits
+# with status 1 if any clip was lost or duplicated, or if, unless in high
+# rate mode, most pastes found the pasteboard empty, since then the test
+# has not exercised clipssh.
+
+set version [package require clipssh]
+source [file join [file dirname [info script]] common.tcl]
+
+getopts {
+    -sim ./managersim
+    -duration 3600
+    -interps 4
+    -rate 2
+    -requestors 2
+    -pasterate 4
+    -delay 20
+    -linger 0
+    -report 60
+    -threads 0
+}
+set interval [expr {1000.0 / ($opts(-interps) * $opts(-rate))}]
+set highRate [expr {$interval <= $opts(-delay)}]
+if {$highRate} {
+    puts [format "high rate: clipssh is called every %.1f ms, within the\
+	    delay of %d ms, so most clips are replaced before they are\
+	    offered" $interval $opts(-delay)]
+}
+if {$opts(-threads) > 0} {
+    package require Thread
+}
+
+set grace 5000000
+set slack 100000		;# Allowance for the clear after the linger.
+array set stats {
+    calls 0 errors 0 pastes 0 empty 0 noted 0 lost 0 duplicated 0
+    lingered 0 replaced 0
+}
+set current {}			;# The secret of the latest call.
+set callTimes {}
+set pasteTimes {}
+set received [dict create]	;# secret -> time, awaiting its notification
+set noted [dict create]		;# secret -> time, awaiting its paste
+set seen [dict create]		;# secret -> time, for finding duplicates
+
+# Fire one clip from interpreter i and schedule the next.
+
+proc fire {i n} {
+    global opts stats callTimes current seen
+    set secret "soak-$i-$n-[expr {int(rand() * 1e9)}]"
+    if {$current ne "" && ![dict exists $seen $current]} {
+	incr stats(replaced)
+    }
+    set current $secret
+    set start [clock microseconds]
+    if {[catch {
+	interp eval child$i [list clipssh -delay $opts(-delay) \
+		-linger $opts(-linger) -command [list noted $secret] $secret]
+    } message]} {
+	incr stats(errors)
+	puts stderr "clipssh failed: $message"
+    }
+    lappend callTimes [expr {[clock microseconds] - $start}]
+    incr stats(calls)
+    after [expr {int(1000.0 / $opts(-rate))}] [list fire $i [incr n]]
+}
+
+# The script which sets up each of the -threads threads.  Its counts are
+# kept in its own stats array, which threadStats adds up.
+
+set threadScript {
+    array set stats {calls 0 delivered 0 failed 0 errors 0}
+    if {![catch {clipssh soak} message]} {
+	incr stats(errors)
+	puts stderr "clipssh used the clipboard outside the main thread"
+    }
+    proc delivered {info} {
+	incr ::stats(delivered)
+    }
+    interp bgerror {} [list apply {{message options} {
+	incr ::stats(failed)
+	puts stderr "clipssh -exec failed: $message"
+    }}]
+    proc fire {t n ms} {
+	if {[catch {
+	    clipssh -exec {sh -c {cat > /dev/null}} -command delivered \
+		    "soak-thread-$t-$n"
+	} message]} {
+	    incr ::stats(errors)
+	    puts stderr "clipssh failed: $message"
+	}
+	incr ::stats(calls)
+	after $ms [list fire $t [incr n] $ms]
+    }
+    proc stop {} {
+	foreach id [after info] {
+	    after cancel $id
+	}
+    }
+}
+
+proc threadStats {} {
+    global threads
+    array set total {calls 0 delivered 0 failed 0 errors 0}
+    foreach tid $threads {
+	foreach {name value} [thread::send $tid {array get stats}] {
+	    incr total($name) $value
+	}
+    }
+    return [array get total]
+}
+
+# Called, through an alias, by the -command script of a clip.
+
+proc noted {secret info} {
+    global stats received noted
+    incr stats(noted)
+    if {[dict exists $received $secret]} {
+	dict unset received $secret
+    } else {
+	dict set noted $secret [clock microseconds]
+    }
+}
+
+# Paste from requestor j and schedule the next paste when this one is done.
+
+proc paste {j} {
+    set chan [open |[list $::opts(-sim) paste] r]
+    fconfigure $chan -blocking 0
+    fileevent $chan readable [list pasted $j $chan [clock microseconds] {}]
+}
+
+proc pasted {j chan start lines} {
+    global opts stats pasteTimes received noted seen slack
+    while {[gets $chan line] >= 0} {
+	lappend lines $line
+    }
+    if {![eof $chan]} {
+	fileevent $chan readable [list pasted $j $chan $start $lines]
+	return
+    }
+    catch {close $chan}
+    set now [clock microseconds]
+    lappend pasteTimes [expr {$now - $start}]
+    incr stats(pastes)
+    set secret [lindex $lines 0]
+    if {$secret eq ""} {
+	incr stats(empty)
+    } elseif {[dict exists $seen $secret]} {
+	if {$start < [dict get $seen $secret] + $opts(-linger) * 1000
+		+ $slack} {
+	    incr stats(lingered)
+	} else {
+	    incr stats(duplicated)
+	    puts stderr "duplicated paste of $secret"
+	}
+    } else {
+	dict set seen $secret $now
+	if {[dict exists $noted $secret]} {
+	    dict unset noted $secret
+	} else {
+	    dict set received $secret $now
+	}
+    }
+    after [expr {int(1000.0 / $opts(-pasterate))}] [list paste $j]
+}
+
+# Count clips whose paste or notification did not arrive in time, and
+# forget old ones.
+
+proc expire {} {
+    global grace stats received noted seen
+    set limit [expr {[clock microseconds] - $grace}]
+    foreach var {received noted} what {"paste without notification"
+	    "notification without paste"} {
+	dict for {secret time} [set $var] {
+	    if {$time < $limit} {
+		incr stats(lost)
+		puts stderr "lost: $what for $secret"
+		dict unset $var $secret
+	    }
+	}
+    }
+    set limit [expr {$limit - 12 * $grace}]
+    dict for {secret time} $seen {
+	if {$time < $limit} {
+	    dict unset seen $secret
+	}
+    }
+}
+
+proc report {} {
+    global opts stats callTimes pasteTimes startRss lastReport threads \
+	    highRate execStats
+    expire
+    set now [clock microseconds]
+    set elapsed [expr {($now - $lastReport) / 1e6}]
+    set lastReport $now
+    puts [format "%s calls/s %.1f  call p99 %s us  paste p99 %s us  \
+	    rss %d kB (+%d)  pastes %d empty %d lingered %d replaced %d\
+	    lost %d duplicated %d errors %d" \
+	    [clock format [clock seconds] -format %T] \
+	    [expr {[llength $callTimes] / $elapsed}] \
+	    [percentile $callTimes 0.99] [percentile $pasteTimes 0.99] \
+	    [rss] [expr {[rss] - $startRss}] $stats(pastes) $stats(empty) \
+	    $stats(lingered) $stats(replaced) $stats(lost) \
+	    $stats(duplicated) $stats(errors)]
+    if {$threads ne ""} {
+	set execStats [threadStats]
+	dict with execStats {
+	    puts "         exec calls $calls delivered $delivered failed\
+		    $failed errors $errors"
+	}
+    }
+    if {!$highRate && 2 * $stats(empty) > $stats(pastes)} {
+	puts "warning: most pastes found the pasteboard empty"
+    }
+    flush stdout
+    set callTimes {}
+    set pasteTimes {}
+    after [expr {$opts(-report) * 1000}] report
+}
+
+for {set i 0} {$i < $opts(-interps)} {incr i} {
+    interp create child$i
+    # Pass on how the package is loaded, which a child of a shell with the
+    # package linked in statically would not know.
+    interp eval child$i [list package ifneeded clipssh $version \
+	    [package ifneeded clipssh $version]]
+    interp eval child$i {package require clipssh}
+    interp alias child$i noted {} noted
+    after [expr {int(rand() * 1000.0 / $opts(-rate))}] [list fire $i 0]
+}
+set threads {}
+for {set t 0} {$t < $opts(-threads)} {incr t} {
+    set tid [thread::create]
+    thread::send $tid [list package ifneeded clipssh $version \
+	    [package ifneeded clipssh $version]]
+    thread::send $tid {package require clipssh}
+    thread::send $tid $threadScript
+    set ms [expr {int(1000.0 / $opts(-rate))}]
+    thread::send $tid [list after [expr {int(rand() * $ms)}] \
+	    [list fire $t 0 $ms]]
+    lappend threads $tid
+}
+for {set j 0} {$j < $opts(-requestors)} {incr j} {
+    after [expr {int(rand() * 1000.0 / $opts(-pasterate))}] [list paste $j]
+}
+set startRss [rss]
+set lastReport [clock microseconds]
+after [expr {$opts(-report) * 1000}] report
+after [expr {$opts(-duration) * 1000}] {set finished 1}
+vwait finished
+
+# Let the last pastes and notifications arrive, then account for them.
+
+foreach id [after info] {
+    after cancel $id
+}
+foreach tid $threads {
+    thread::send $tid stop
+}
+after [expr {$grace / 1000}] {set settled 1}
+vwait settled
+set lastReport [expr {$lastReport + $grace}]
+set grace 0
+report
+foreach id [after info] {
+    after cancel $id
+}
+puts "total: $stats(calls) calls, $stats(noted) notifications,\
+	$stats(pastes) pastes, $stats(empty) empty, $stats(replaced)\
+	replaced, $stats(lost) lost, $stats(duplicated) duplicated"
+if {$threads ne ""} {
+    dict with execStats {
+	set unaccounted [expr {$calls - $delivered - $failed - $errors}]
+	puts "exec: $calls calls, $delivered delivered, $failed failed,\
+		$errors errors, $unaccounted lost"
+	incr stats(lost) $unaccounted
+	incr stats(errors) [expr {$failed + $errors}]
+    }
+    foreach tid $threads {
+	thread::release $tid
+    }
+}
+exit [expr {$stats(lost) + $stats(duplicated) + $stats(errors) > 0
+	|| (!$highRate && 2 * $stats(empty) > $stats(pastes))}]
@@ -0,0 +1,51 @@
+# startup.tcl --
+#
+#	Measure how long [package require clipssh] takes in a fresh shell, and
+#	how large the binary which provides the package is.
+#
+# Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+#
+# This file is part of the Clipssh project.  Clipssh is distributed under the
+# Tcl license.  The terms of the license are described in the file
+# "license.terms" which should be included with this distribution.
+#
+# Usage: tclsh startup.tcl ?-option value ...?
+#
+#   -shell path		The shell to start (default: this tclsh).  For a
+#			static build this is the clipsshsh built by
+#			"make startup".
+#   -binary path	The shared library or executable whose size is
+#			reported.
+#   -runs n		Number of shells to start (default 50).
+#
+# The shell is started with the environment of this script, so for a shared
+# build TCLLIBPATH must lead to the pkgIndex.tcl of the build, as it does
+# when the script is run by "make startup".
+
+source [file join [file dirname [info script]] common.tcl]
+
+getopts [list -shell [info nameofexecutable] -binary {} -runs 50]
+
+set script {
+    set start [clock microseconds]
+    package require clipssh
+    puts [expr {[clock microseconds] - $start}]
+}
+
+set require {}
+set total {}
+for {set i 0} {$i < $opts(-runs)} {incr i} {
+    set start [clock microseconds]
+    lappend require [string trim [exec $opts(-shell) << $script]]
+    lappend total [expr {[clock microseconds] - $start}]
+}
+
+puts "shell:                  $opts(-shell)"
+if {$opts(-binary) ne ""} {
+    puts "binary:                 $opts(-binary)\
+	    ([file size $opts(-binary)] bytes)"
+}
+puts "package require (us):   median [percentile $require 0.5],\
+	min [tcl::mathfunc::min {*}$require]"
+puts "whole process (us):     median [percentile $total 0.5],\
+	min [tcl::mathfunc::min {*}$total]"
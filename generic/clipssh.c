@@ -12,12 +12,161 @@
 extern "C" {
 #endif  /* __cplusplus */
 
-#include "tcl.h"
-#include "tk.h"
+#include "clipsshInt.h"
 #include <string.h>
 
-extern void addTransientClip(Tk_Window tkwin, const char *clip, double delay);
-extern void initPasteboard();
+/*
+ * One of these is created for each interpreter which loads the package.  It
+ * is the clientData of the clipssh command, and it is handed to the backend
+ * as the token which identifies the interpreter to notify after a paste.
+ * It is freed with Tcl_EventuallyFree since paste events may still refer to
+ * it after the command has been deleted.
+ */
+
+typedef struct ClipsshInterpData {
+    Tcl_Interp *interp;		/* The interpreter, or NULL once the command
+				 * has been deleted. */
+    int useTk;			/* Non-zero if Tk was loaded in the interp,
+				 * so that <<ClipsshPaste>> can be sent. */
+    int pasteboard;		/* Non-zero if the interp lives in the thread
+				 * which may use the clipboard. */
+} ClipsshInterpData;
+
+/*
+ * The Tcl event which is queued by the backend when a clip is pasted.
+ */
+
+typedef struct ClipsshPasteEvent {
+    Tcl_Event header;		/* Standard Tcl event header. */
+    ClipsshInterpData *dataPtr;	/* The interpreter to notify. */
+    Tcl_Obj *command;		/* The -command script of the clip which was
+				 * pasted, or NULL. */
+    ClipsshPasteInfo info;	/* What the backend measured. */
+} ClipsshPasteEvent;
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ClipsshPasteEventProc --
+ *
+ *	This procedure is invoked by the Tcl event loop to process a
+ *	ClipsshPasteEvent.
+ *
+ * Results:
+ *	Returns 1 if the event was handled, 0 if it should be deferred.
+ *
+ * Side effects:
+ *	The <<ClipsshPaste>> virtual event is sent to the main window, if Tk
+ *	is loaded, and the -command script of the clip, if any, is evaluated.
+ *	Both receive a dictionary with the length of the clip in bytes, and
+ *	the latency and transfer time of the paste in microseconds: the event
+ *	as its %d detail and the script as an extra argument.  If the clip
+ *	could not be delivered a background error is reported instead.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+ClipsshPasteEventProc(
+    Tcl_Event *evPtr,		/* The ClipsshPasteEvent. */
+    int flags)			/* Flags passed to Tcl_DoOneEvent. */
+{
+    ClipsshPasteEvent *pastePtr = (ClipsshPasteEvent *) evPtr;
+    ClipsshInterpData *dataPtr = pastePtr->dataPtr;
+    Tcl_Interp *interp = dataPtr->interp;
+    Tcl_Obj *infoObj;
+
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+	return 0;
+    }
+    if (interp != NULL && pastePtr->info.error != 0) {
+	Tcl_Preserve(interp);
+	Tcl_SetErrno(pastePtr->info.error);
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"couldn't deliver clip: %s", Tcl_PosixError(interp)));
+	Tcl_BackgroundException(interp, TCL_ERROR);
+	Tcl_Release(interp);
+    } else if (interp != NULL) {
+	Tcl_Preserve(interp);
+	infoObj = Tcl_NewDictObj();
+	Tcl_IncrRefCount(infoObj);
+	Tcl_DictObjPut(NULL, infoObj, Tcl_NewStringObj("length", -1),
+		Tcl_NewWideIntObj((Tcl_WideInt) pastePtr->info.length));
+	Tcl_DictObjPut(NULL, infoObj, Tcl_NewStringObj("latency", -1),
+		Tcl_NewWideIntObj((Tcl_WideInt) pastePtr->info.latency / 1000));
+	Tcl_DictObjPut(NULL, infoObj, Tcl_NewStringObj("transfer", -1),
+		Tcl_NewWideIntObj((Tcl_WideInt) pastePtr->info.transfer / 1000));
+#ifndef CLIPSSH_NO_TK
+	if (dataPtr->useTk) {
+	    Tk_Window tkwin = Tk_MainWindow(interp);
+
+	    if (tkwin != NULL) {
+		CLIPSSH_TRACE(PASTE_EVENT, pastePtr->info.length);
+		Tk_SendVirtualEvent(tkwin, "ClipsshPaste", infoObj);
+	    }
+	}
+#endif /* CLIPSSH_NO_TK */
+	if (pastePtr->command != NULL) {
+	    Tcl_Obj *command = Tcl_DuplicateObj(pastePtr->command);
+	    Tcl_Obj *argObj = Tcl_NewListObj(1, &infoObj);
+
+	    Tcl_IncrRefCount(command);
+	    Tcl_AppendToObj(command, " ", 1);
+	    Tcl_AppendObjToObj(command, argObj);
+	    Tcl_DecrRefCount(argObj);
+	    if (Tcl_EvalObjEx(interp, command, TCL_EVAL_GLOBAL) != TCL_OK) {
+		Tcl_BackgroundException(interp, TCL_ERROR);
+	    }
+	    Tcl_DecrRefCount(command);
+	}
+	Tcl_DecrRefCount(infoObj);
+	Tcl_Release(interp);
+    }
+    if (pastePtr->command != NULL) {
+	Tcl_DecrRefCount(pastePtr->command);
+    }
+    Tcl_Release(dataPtr);
+    return 1;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ClipsshNotifyPaste --
+ *
+ *	Called by the backend, in the thread of the interpreter, when a clip
+ *	has been pasted, or could not be delivered.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A ClipsshPasteEvent is queued.
+ *
+ *--------------------------------------------------------------
+ */
+
+void
+ClipsshNotifyPaste(
+    void *clientData,		/* The ClipsshInterpData of the clip. */
+    Tcl_Obj *command,		/* The -command script of the clip, or
+				 * NULL. */
+    const ClipsshPasteInfo *infoPtr)
+				/* What was measured during the paste. */
+{
+    ClipsshPasteEvent *pastePtr = (ClipsshPasteEvent *)
+	    ckalloc(sizeof(ClipsshPasteEvent));
+
+    pastePtr->header.proc = ClipsshPasteEventProc;
+    pastePtr->dataPtr = (ClipsshInterpData *) clientData;
+    pastePtr->command = command;
+    if (command != NULL) {
+	Tcl_IncrRefCount(command);
+    }
+    pastePtr->info = *infoPtr;
+    Tcl_Preserve(pastePtr->dataPtr);
+    Tcl_QueueEvent((Tcl_Event *) pastePtr, TCL_QUEUE_TAIL);
+}
 
 /*
  *--------------------------------------------------------------
@@ -30,42 +179,169 @@ extern void initPasteboard();
  *	A standard Tcl result.
  *
  * Side effects:
- *	A transient clip is quietly added to the system clipboard.
+ *	A transient clip is quietly added to the system clipboard.  Only the
+ *	thread which owns the clipboard, the main thread on macOS, may do
+ *	this; in other threads the command fails unless -exec is given.
  *
  *--------------------------------------------------------------
  */
 
-int
+static int
 ClipsshObjCmd(
     void *clientData,
     Tcl_Interp *interp,		/* Current interpreter. */
     int objc,			/* Number of arguments. */
     Tcl_Obj *const objv[])	/* Argument objects. */
 {
-    Tk_Window tkwin = (Tk_Window) clientData;
+    ClipsshInterpData *dataPtr = (ClipsshInterpData *) clientData;
+    Tcl_Obj *command = NULL, *execObj = NULL;
     const char *clip;
-    int millis = 500;
+    int i, index, value, haveCount = 0, result = TCL_OK;
     Tcl_Size length;
-    static const char *const optionStrings[] = {"-delay", NULL};
-    if (objc != 2 && objc != 4) {
-	Tcl_WrongNumArgs(interp, 1, objv, "?-delay millis? string");
+    ClipsshOptions options = {0.5, 1, 0.0, 0, 0.1, NULL};
+    static const char *const optionStrings[] = {
+	"-command", "-count", "-delay", "-exec", "-linger", "-restore",
+	"-window", NULL
+    };
+    enum options {
+	CLIPSSH_COMMAND, CLIPSSH_COUNT, CLIPSSH_DELAY, CLIPSSH_EXEC,
+	CLIPSSH_LINGER, CLIPSSH_RESTORE, CLIPSSH_WINDOW
+    };
+
+    if (objc % 2 != 0) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-option value ...? string");
 	return TCL_ERROR;
     }
     clip = Tcl_GetStringFromObj(objv[objc -1], &length);
-    if (objc == 4) {
-	if (Tcl_GetIndexFromObj(NULL, objv[1], optionStrings,
-				"option", 0, NULL) != TCL_OK) {
-	    return TCL_ERROR;
+    CLIPSSH_TRACE(CMD_ENTRY, length);
+    for (i = 1; i < objc - 1; i += 2) {
+	if (Tcl_GetIndexFromObj(interp, objv[i], optionStrings,
+				"option", 0, &index) != TCL_OK) {
+	    result = TCL_ERROR;
+	    goto done;
 	}
-	if (Tcl_GetIntFromObj(interp, objv[2], &millis) != TCL_OK) {
-	    return TCL_ERROR;
+	if (index == CLIPSSH_COMMAND) {
+	    command = objv[i + 1];
+	    continue;
+	}
+	if (index == CLIPSSH_EXEC) {
+	    execObj = objv[i + 1];
+	    continue;
+	}
+	if (index == CLIPSSH_RESTORE) {
+	    if (Tcl_GetBooleanFromObj(interp, objv[i + 1],
+				      &options.restore) != TCL_OK) {
+		result = TCL_ERROR;
+		goto done;
+	    }
+	    continue;
+	}
+	if (Tcl_GetIntFromObj(interp, objv[i + 1], &value) != TCL_OK) {
+	    result = TCL_ERROR;
+	    goto done;
+	}
+	if (value < 0 || (index == CLIPSSH_COUNT && value == 0)) {
+	    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"bad value for %s: must be a %s integer",
+		optionStrings[index],
+		index == CLIPSSH_COUNT ? "positive" : "non-negative"));
+	    result = TCL_ERROR;
+	    goto done;
+	}
+	switch ((enum options) index) {
+	case CLIPSSH_COUNT:
+	    options.count = value;
+	    haveCount = 1;
+	    break;
+	case CLIPSSH_DELAY:
+	    options.delay = value / 1000.0;
+	    break;
+	case CLIPSSH_LINGER:
+	    options.linger = value / 1000.0;
+	    break;
+	case CLIPSSH_WINDOW:
+	    options.window = value / 1000.0;
+	    break;
+	case CLIPSSH_COMMAND:
+	case CLIPSSH_EXEC:
+	case CLIPSSH_RESTORE:
+	    break;
 	}
     }
-    if (tkwin == 0) {
-	tkwin = Tk_MainWindow(interp);
+
+    /*
+     * A paste window without a paste count serves any number of pastes
+     * until the window closes.
+     */
+
+    if (options.window > 0 && !haveCount) {
+	options.count = 0;
     }
-    addTransientClip(tkwin, clip, millis / 1000.0);
-    return TCL_OK;
+    if (command != NULL && Tcl_GetCharLength(command) > 0) {
+	options.command = command;
+    }
+
+    /*
+     * With -exec the clip goes straight to a process and the clipboard is
+     * not touched.
+     */
+
+    if (execObj != NULL) {
+#ifdef _WIN32
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(
+		"-exec is not supported on this platform", -1));
+	result = TCL_ERROR;
+#else
+	result = execClip(interp, execObj, clip, length, &options, dataPtr);
+#endif /* _WIN32 */
+	goto done;
+    }
+    if (!dataPtr->pasteboard) {
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(
+		"the clipboard can only be used from the main thread,"
+		" other threads must give -exec", -1));
+	result = TCL_ERROR;
+	goto done;
+    }
+    addTransientClip(clip, length, &options, dataPtr);
+
+  done:
+    CLIPSSH_TRACE(CMD_EXIT, length);
+    return result;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ClipsshDeleteCmd --
+ *
+ *	This procedure is invoked when the "clipssh" command is deleted,
+ *	usually because its interpreter is being deleted.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The backend forgets the interpreter, and its ClipsshInterpData is
+ *	freed once no paste event refers to it.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+ClipsshDeleteCmd(
+    void *clientData)		/* The ClipsshInterpData. */
+{
+    ClipsshInterpData *dataPtr = (ClipsshInterpData *) clientData;
+
+    if (dataPtr->pasteboard) {
+	cancelTransientClip(dataPtr);
+    }
+#ifndef _WIN32
+    cancelExecClip(dataPtr);
+#endif /* _WIN32 */
+    dataPtr->interp = NULL;
+    Tcl_EventuallyFree(dataPtr, TCL_DYNAMIC);
 }
 
 /*
@@ -79,7 +355,10 @@ ClipsshObjCmd(
  *	A standard Tcl result
  *
  * Side effects:
- *	The Clipssh package is created.
+ *	The Clipssh package is created.  Tk is used for the <<ClipsshPaste>>
+ *	event only if it has already been loaded into the interpreter, so
+ *	the package can also be used from tclsh.  The clipboard backend is
+ *	only set up when the package is loaded in the main thread.
  *
  *----------------------------------------------------------------------
  */
@@ -88,24 +367,81 @@ DLLEXPORT int
 Clipssh_Init(
     Tcl_Interp* interp)		/* Tcl interpreter */
 {
+    ClipsshInterpData *dataPtr;
+
     if (Tcl_InitStubs(interp, TCL_VERSION, 0) == NULL) {
 	return TCL_ERROR;
     }
 
-    if (Tk_InitStubs(interp, TK_VERSION, 0) == NULL) {
-        return TCL_ERROR;
+    dataPtr = (ClipsshInterpData *) ckalloc(sizeof(ClipsshInterpData));
+    dataPtr->interp = interp;
+    dataPtr->useTk = 0;
+    dataPtr->pasteboard = isPasteboardThread();
+#ifndef CLIPSSH_NO_TK
+    if (Tcl_PkgPresent(interp, "Tk", NULL, 0) != NULL) {
+	if (Tk_InitStubs(interp, TK_VERSION, 0) == NULL) {
+	    ckfree(dataPtr);
+	    return TCL_ERROR;
+	}
+	dataPtr->useTk = 1;
     }
+    Tcl_ResetResult(interp);
+#endif /* CLIPSSH_NO_TK */
     if (Tcl_PkgProvideEx(interp, PACKAGE_NAME, PACKAGE_VERSION, NULL) != TCL_OK) {
+	ckfree(dataPtr);
 	return TCL_ERROR;
     }
     if (!Tcl_CreateObjCommand(interp, "clipssh", (Tcl_ObjCmdProc *)ClipsshObjCmd,
-			      NULL, NULL)) {
+			      dataPtr, ClipsshDeleteCmd)) {
+	ckfree(dataPtr);
 	return TCL_ERROR;
     }
-    initPasteboard();
+    if (dataPtr->pasteboard) {
+	initPasteboard();
+    }
     return TCL_OK;
 }
 
+#ifdef STATIC_BUILD
+/*
+ *----------------------------------------------------------------------
+ *
+ * Clipssh_StaticRegister --
+ *
+ *	Register the Clipssh package with Tcl as a library linked into the
+ *	application.  This is called from the Tcl_AppInit of an application
+ *	which links a static build of the package.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	[load {} Clipssh] will initialize the package from the application
+ *	itself, in any interpreter.  [package require clipssh] will do so in
+ *	the interpreter passed in only, since the package ifneeded script is
+ *	known only there; other interpreters must use [load {} Clipssh] or
+ *	be given the script.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#if TCL_MAJOR_VERSION < 9 && TCL_MINOR_VERSION < 7
+#define Tcl_StaticLibrary Tcl_StaticPackage
+#endif
+
+DLLEXPORT int
+Clipssh_StaticRegister(
+    Tcl_Interp* interp)		/* Tcl interpreter */
+{
+    if (Tcl_InitStubs(interp, TCL_VERSION, 0) == NULL) {
+	return TCL_ERROR;
+    }
+    Tcl_StaticLibrary(NULL, "Clipssh", Clipssh_Init, NULL);
+    return Tcl_EvalEx(interp, "package ifneeded " PACKAGE_NAME " "
+	    PACKAGE_VERSION " {load {} Clipssh}", -1, TCL_EVAL_GLOBAL);
+}
+#endif /* STATIC_BUILD */
+
 #ifdef __cplusplus
 }
 #endif  /* __cplusplus */
@@ -0,0 +1,44 @@
+/*
+ * clipssh.h --
+ *
+ *	Public interface of the Clipssh package, for applications which link
+ *	a static build of the package (configure --disable-shared) instead of
+ *	loading it with [package require].
+ *
+ *	Such an application calls Clipssh_StaticRegister from its
+ *	Tcl_AppInit.  After that [package require clipssh] loads the package
+ *	from the executable itself, without searching for and opening a
+ *	shared library.
+ *
+ * Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+ *
+ * This file is part of the Clipssh project.  Clipssh is distributed under the
+ * Tcl license.  The terms of the license are described in the file
+ * "license.terms" which should be included with this distribution.
+ */
+
+#ifndef _CLIPSSH
+#define _CLIPSSH
+
+#include "tcl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  /* __cplusplus */
+
+extern DLLEXPORT int	Clipssh_Init(Tcl_Interp *interp);
+extern DLLEXPORT int	Clipssh_StaticRegister(Tcl_Interp *interp);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif /* _CLIPSSH */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * End:
+ */
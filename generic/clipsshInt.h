@@ -0,0 +1,161 @@
+/*
+ * clipsshInt.h --
+ *
+ *	Declarations shared by the generic command code and the platform
+ *	specific clipboard backends.
+ *
+ * Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+ *
+ * This file is part of the Clipssh project.  Clipssh is distributed under the
+ * Tcl license.  The terms of the license are described in the file
+ * "license.terms" which should be included with this distribution.
+ */
+
+#ifndef _CLIPSSHINT
+#define _CLIPSSHINT
+
+#include "clipssh.h"
+#ifndef CLIPSSH_NO_TK
+#include "tk.h"
+#endif
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  /* __cplusplus */
+
+/*
+ * The functions below are shared between the files of the package but are
+ * not part of its interface.  When the compiler supports it, configure
+ * defines MODULE_SCOPE to give them hidden visibility, so that a static
+ * build exports nothing but the public functions in clipssh.h.
+ */
+
+#ifndef MODULE_SCOPE
+#define MODULE_SCOPE extern
+#endif
+
+/*
+ * A monotonic clock in nanoseconds, for the timings reported after a paste.
+ */
+
+static inline uint64_t
+ClipsshNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Static tracepoints.  When the package is configured with DTrace support,
+ * the default on macOS when dtrace is found, each step of the life cycle of
+ * a clip fires a probe of the "clipssh" provider declared in clipssh.d.
+ * The probes are named in the macro in upper case, as in the header which
+ * "dtrace -h" generates, e.g. CLIPSSH_TRACE(CMD_ENTRY, length) fires the
+ * cmd-entry probe.  The tracer supplies its own timestamp, so the latency
+ * between any two steps can be measured without rebuilding, e.g.
+ *
+ *   dtrace -n 'clipssh*:::become-owner { t = timestamp; }
+ *              clipssh*:::provide { printf("%d ns\n", timestamp - t); }'
+ *
+ * The argument is only evaluated while the probe is enabled.  Without
+ * DTrace support the macro expands to nothing.
+ */
+
+#ifdef USE_DTRACE
+#include "clipsshProbes.h"
+
+#define CLIPSSH_TRACE(probe, length) \
+    do { \
+	if (CLIPSSH_##probe##_ENABLED()) { \
+	    CLIPSSH_##probe((size_t) (length)); \
+	} \
+    } while (0)
+#else
+#define CLIPSSH_TRACE(probe, length)
+#endif /* USE_DTRACE */
+
+/*
+ * The options of the clipssh command which are passed on to the backend.
+ */
+
+typedef struct ClipsshOptions {
+    double delay;		/* Seconds to wait after clearing the
+				 * clipboard before promising the clip. */
+    int count;			/* Number of pastes to serve before the clip
+				 * is wiped, or 0 for no limit. */
+    double window;		/* Seconds after the first paste during which
+				 * further pastes are served, or 0 for no
+				 * limit. */
+    int restore;		/* Non-zero to put the previous contents of
+				 * the clipboard back when the clip is
+				 * done. */
+    double linger;		/* Seconds to leave a pasted clip on the
+				 * clipboard before clearing it. */
+    Tcl_Obj *command;		/* The -command script, or NULL.  A backend
+				 * which keeps it must hold a reference. */
+} ClipsshOptions;
+
+/*
+ * What the backend measured during a paste, reported to the script.
+ */
+
+typedef struct ClipsshPasteInfo {
+    size_t length;		/* Length of the clip in bytes. */
+    uint64_t latency;		/* Nanoseconds from the moment the clip was
+				 * made available until the paste began. */
+    uint64_t transfer;		/* Nanoseconds spent handing the clip over to
+				 * the requestor. */
+    int error;			/* An errno value if the clip could not be
+				 * delivered, otherwise 0. */
+} ClipsshPasteInfo;
+
+/*
+ * Functions provided by the platform specific clipboard backend.  The
+ * clientData passed to addTransientClip is handed back to
+ * ClipsshNotifyPaste, with the -command script of the clip, after each
+ * paste of the clip.  This continues until the clip is replaced or
+ * cancelTransientClip is called with the same clientData.  The clipboard
+ * belongs to one thread, and only that thread may call these functions; it
+ * is the one for which isPasteboardThread returns non-zero.
+ */
+
+MODULE_SCOPE void	addTransientClip(const char *clip, size_t length,
+		    const ClipsshOptions *options, void *clientData);
+MODULE_SCOPE void	cancelTransientClip(void *clientData);
+MODULE_SCOPE void	initPasteboard(void);
+MODULE_SCOPE int	isPasteboardThread(void);
+
+/*
+ * Functions which deliver a clip to the standard input of a process instead
+ * of the clipboard, on platforms with POSIX pipes.  The clientData is used
+ * as for addTransientClip.
+ */
+
+MODULE_SCOPE int	execClip(Tcl_Interp *interp, Tcl_Obj *cmdObj,
+		    const char *clip, size_t length,
+		    const ClipsshOptions *options, void *clientData);
+MODULE_SCOPE void	cancelExecClip(void *clientData);
+
+/*
+ * Function provided by the generic code to the backend.
+ */
+
+MODULE_SCOPE void	ClipsshNotifyPaste(void *clientData, Tcl_Obj *command,
+		    const ClipsshPasteInfo *infoPtr);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif /* _CLIPSSHINT */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * End:
+ */
@@ -1,19 +1,280 @@
-#include <tcl.h>
-#include <tk.h>
+#define __STDC_WANT_LIB_EXT1__ 1
+#include <stdlib.h>
+#include <string.h>
+#include "clipsshInt.h"
 #import <AppKit/NSPasteboard.h>
 #import <CoreFoundation/CoreFoundation.h>
 #import <Cocoa/Cocoa.h>
 
+// A copy of whatever was on the general pasteboard before a clip was added
+// with the -restore option.  The data has to be read before the pasteboard
+// is cleared, since clearing it revokes the promises of the application
+// which wrote it, so this is only done when -restore is requested.  When the
+// contents are put back they are promised through the
+// NSPasteboardItemDataProvider protocol rather than written, so that large
+// data is only handed to the pasteboard again if somebody pastes it.
+
+@interface savedContents: NSObject <NSPasteboardItemDataProvider>
+{
+    NSMutableArray *itemData;	// A type -> data dictionary for each item.
+    NSMutableArray *items;	// The items promised by restoreTo:.
+}
+
+- (instancetype) initWithPasteboard: (NSPasteboard *) pb;
+- (void) restoreTo: (NSPasteboard *) pb;
+
+@end
+
+@implementation savedContents
+
+- (instancetype) initWithPasteboard: (NSPasteboard *) pb
+{
+    self = [super init];
+    if (self) {
+	itemData = [[NSMutableArray alloc] init];
+	items = [[NSMutableArray alloc] init];
+	@autoreleasepool {
+	    for (NSPasteboardItem *item in pb.pasteboardItems) {
+		NSMutableDictionary *data = [NSMutableDictionary dictionary];
+		for (NSString *type in item.types) {
+		    NSData *value = [item dataForType:type];
+		    if (value) {
+			[data setObject:value forKey:type];
+		    }
+		}
+		[itemData addObject:data];
+	    }
+	}
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    [itemData release];
+    [items release];
+    [super dealloc];
+}
+
+// Put the saved contents back.
+
+- (void) restoreTo: (NSPasteboard *) pb
+{
+    @autoreleasepool {
+	[pb clearContents];
+	[items removeAllObjects];
+	for (NSDictionary *data in itemData) {
+	    NSPasteboardItem *item = [[NSPasteboardItem alloc] init];
+	    [item setDataProvider:self forTypes:data.allKeys];
+	    [items addObject:item];
+	    [item release];
+	}
+	[pb writeObjects:items];
+    }
+}
+
+- (void) pasteboard: (NSPasteboard *) pasteboard
+	       item: (NSPasteboardItem *) item
+ provideDataForType: (NSString *) type
+{
+    @autoreleasepool {
+	NSUInteger index = [items indexOfObjectIdenticalTo:item];
+	if (index != NSNotFound) {
+	    [item setData:[[itemData objectAtIndex:index] objectForKey:type]
+		  forType:type];
+	}
+    }
+}
+
+// Once the pasteboard has moved on there is no need to hold the data.
+
+- (void) pasteboardFinishedWithDataProvider: (NSPasteboard *) pasteboard
+{
+    [itemData removeAllObjects];
+    [items removeAllObjects];
+}
+
+@end
+
+// The types we promise, made once rather than on every promise.
+
+static NSArray *stringTypes = nil;
+
+// SipHash-2-4 of a clip, with a key chosen at random when the package is
+// loaded.  Only the hash of the pending clip is kept, to recognize a clip
+// which is copied again, and since the key never leaves the process the hash
+// tells nothing about the clip to anyone who might see it.
+
+static uint64_t sipKey[2];
+
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND \
+    do { \
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+static uint64_t clipHash(const char *clip, size_t length) {
+    const unsigned char *p = (const unsigned char *) clip;
+    uint64_t v0 = sipKey[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = sipKey[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = sipKey[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = sipKey[1] ^ 0x7465646279746573ULL;
+    uint64_t m, last = (uint64_t) length << 56;
+    size_t i, tail = length & 7;
+
+    for (i = 0; i + 8 <= length; i += 8) {
+	memcpy(&m, p + i, 8);
+	m = CFSwapInt64LittleToHost(m);
+	v3 ^= m;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= m;
+    }
+    while (tail--) {
+	last |= (uint64_t) p[i + tail] << (8 * tail);
+    }
+    v3 ^= last;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= last;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+#undef ROTL
+
+// The clip is held as UTF-8 in a buffer owned by the pasteboardOwner.  The
+// buffer only grows, so once it is large enough repeated clips reuse it
+// without allocating, and it is wiped as soon as the clip has been provided
+// or replaced.  An NSString is only created at the moment of a paste, and it
+// is released as soon as the pasteboard has copied it.
+//
+// Once the buffer is large enough, what a call still allocates belongs to
+// Foundation: the timer behind each performSelector:afterDelay:, which is
+// released when it fires or is cancelled.  bench/alloctest.tcl checks that
+// nothing accumulates over many calls.  Every entry point and callback runs
+// in its own autorelease pool, since under tclsh there is no AppKit event
+// loop to drain the objects which Foundation autoreleases.
+//
+// Password managers often copy the same secret again, when a login is
+// retried.  If the clip is still pending the owner keeps it, and its
+// promise, and only takes the new options, so the pasteboard is not cleared
+// and the delay is not waited out a second time.  The clip is recognized by
+// its hash and then compared in constant time.
+//
+// A clip may be pasted more than once, as limited by a count of pastes and
+// by a window of time which opens with the first paste.  After each paste
+// but the last the owner clears the pasteboard and, after the usual delay,
+// makes its promise again, without any help from the script.
+
 @interface pasteboardOwner: NSObject <NSPasteboardTypeOwner>
+{
+    char *buffer;
+    size_t capacity;
+    uint64_t hash;
+    size_t tracedLength;	// The length of the clip, kept after it is
+				// wiped so that the probes can report it.
+}
 
-@property(retain) NSString *clip;
+@property(readonly) size_t length;
+@property(readonly) BOOL live;
 @property NSTimeInterval delay;
-@property Tk_Window tkwin;
+@property int pastesLeft;
+@property NSTimeInterval window;
+@property NSTimeInterval linger;
+@property uint64_t promisedAt;
+@property BOOL windowOpen;
+@property NSInteger changeCount;
+@property(retain) savedContents *saved;
+@property(retain) savedContents *restored;
+@property void *clientData;
+@property Tcl_Obj *command;
+
+- (void) setClip: (const char *) clip
+	  length: (size_t) length
+	    hash: (uint64_t) clipHash;
+- (BOOL) holdsClip: (const char *) clip
+	    length: (size_t) length
+	      hash: (uint64_t) clipHash;
+- (void) wipeClip;
+- (void) restoreSaved: (NSPasteboard *) pb;
 
 @end
 
 @implementation pasteboardOwner
 
+- (void) setClip: (const char *) clip
+	  length: (size_t) length
+	    hash: (uint64_t) clipHash
+{
+    [self wipeClip];
+    if (length > capacity) {
+	buffer = ckrealloc(buffer, length);
+	capacity = length;
+    }
+    memcpy(buffer, clip, length);
+    hash = clipHash;
+    tracedLength = length;
+    _length = length;
+    _live = YES;
+}
+
+// Whether the given clip is the one we are holding.  The time taken does not
+// depend on where the two clips differ.
+
+- (BOOL) holdsClip: (const char *) clip
+	    length: (size_t) length
+	      hash: (uint64_t) clipHash
+{
+    return self.live && length == self.length && clipHash == hash
+	    && timingsafe_bcmp(buffer, clip, length) == 0;
+}
+
+- (void) wipeClip
+{
+    // Unlike memset, memset_s may not be optimized away.
+    if (buffer) {
+	memset_s(buffer, capacity, 0, capacity);
+    }
+    hash = 0;
+    _length = 0;
+    _live = NO;
+}
+
+- (void) dealloc
+{
+    [self wipeClip];
+    ckfree(buffer);
+    [_saved release];
+    [_restored release];
+    if (_command) {
+	Tcl_DecrRefCount(_command);
+    }
+    [super dealloc];
+}
+
+// Put back the contents saved by a clip with the -restore option, if any.
+// The saved contents must stay alive while they provide data lazily.  The
+// changeCount is left as our own clear set it: what is on the pasteboard now
+// belongs to the user, and the next clip with -restore must save it again.
+
+- (void) restoreSaved: (NSPasteboard *) pb
+{
+    if (self.saved) {
+	[self.saved restoreTo: pb];
+	self.restored = self.saved;
+	self.saved = nil;
+    }
+}
+
 // Clang claims that the NSPasteboard is not an NSObject.
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wobjc-method-access"
@@ -29,17 +290,95 @@
 - (void) pasteboard: (NSPasteboard *) sender
  provideDataForType: (NSString *) type
 {
-    // A paste is underway, so we provide our clip to the pasteboard.
-    [sender setString:self.clip forType:type];
-    //Clear our clip.
-    [self setClip: nil];
-    // Clear the pasteboard too, after a short delay.
-    [sender  performSelector: @selector(clearContents) 
-		  withObject: nil 
-		  afterDelay: 0.1
-     ];
-    if (self.tkwin) {
-	Tk_SendVirtualEvent(self.tkwin, "ClipsshPaste", NULL);
+    @autoreleasepool {
+	// A paste is underway, so we provide our clip to the pasteboard.
+	// The pasteboard server holds the requestor until this method
+	// returns, and there is no later signal that the requestor has its
+	// data, so the time reported as the transfer is the time taken to
+	// hand it over.
+	ClipsshPasteInfo info;
+	info.length = self.length;
+	info.error = 0;
+	uint64_t start = ClipsshNow();
+	CLIPSSH_TRACE(PROVIDE, self.length);
+	NSString *clip = [[NSString alloc]
+			     initWithBytes:buffer
+				    length:self.length
+				  encoding:NSUTF8StringEncoding];
+	[sender setString:clip forType:type];
+	[clip release];
+	info.latency = start - self.promisedAt;
+	info.transfer = ClipsshNow() - start;
+	if (self.clientData) {
+	    ClipsshNotifyPaste(self.clientData, self.command, &info);
+	}
+	// Open the paste window, if there is one, on the first paste.
+	if (self.window > 0 && !self.windowOpen) {
+	    self.windowOpen = YES;
+	    [self performSelector: @selector(expire)
+		       withObject: nil
+		       afterDelay: self.window];
+	}
+	// Clear our clip if this was the last paste allowed.  The window has
+	// nothing left to expire, and must not clear the pasteboard after the
+	// previous contents have been put back.
+	if (self.pastesLeft > 0 && --self.pastesLeft == 0) {
+	    [self wipeClip];
+	    [NSObject cancelPreviousPerformRequestsWithTarget:self
+		      selector:@selector(expire) object:nil];
+	}
+	// Clear the pasteboard too, after a short delay.
+	[self performSelector: @selector(delayedClear:)
+		   withObject: sender
+		   afterDelay: self.linger
+	 ];
+    }
+}
+
+- (void) delayedClear: (NSPasteboard *) sender
+{
+    @autoreleasepool {
+	// If something else was copied while the clip lingered, the
+	// pasteboard holds the user's copy now.  It is not cleared, and the
+	// clip and any saved contents are dropped, as in becomeOwner.
+	if (sender.changeCount != self.changeCount) {
+	    [NSObject cancelPreviousPerformRequestsWithTarget:self];
+	    [self wipeClip];
+	    self.saved = nil;
+	    return;
+	}
+	CLIPSSH_TRACE(DELAYED_CLEAR, tracedLength);
+	self.changeCount = [sender clearContents];
+	// If more pastes are allowed, renew the promise after the usual
+	// delay.  Otherwise the clip is done, and the previous contents can
+	// go back.
+	if (self.live) {
+	    [self performSelector: @selector(becomeOwner)
+		       withObject: nil
+		       afterDelay: self.delay];
+	} else {
+	    [self restoreSaved: sender];
+	}
+    }
+}
+
+// Called when the paste window closes.  Any pending promise is dropped, the
+// clip is wiped and, unless something else has been copied since we last
+// cleared it, so is the pasteboard.
+
+- (void) expire
+{
+    @autoreleasepool {
+	NSPasteboard *pb = [NSPasteboard generalPasteboard];
+	[NSObject cancelPreviousPerformRequestsWithTarget:self];
+	[self wipeClip];
+	if (pb.changeCount == self.changeCount) {
+	    CLIPSSH_TRACE(DELAYED_CLEAR, tracedLength);
+	    self.changeCount = [pb clearContents];
+	    [self restoreSaved: pb];
+	} else {
+	    self.saved = nil;
+	}
     }
 }
 
@@ -66,10 +405,22 @@
 
 - (void) becomeOwner
 {
-    NSPasteboard *pb = [NSPasteboard generalPasteboard];
-    // This does not increment the changeCount!
-    [pb addTypes:[NSArray arrayWithObject:NSPasteboardTypeString]
-	   owner:self];
+    @autoreleasepool {
+	NSPasteboard *pb = [NSPasteboard generalPasteboard];
+	// If something else has been copied since we cleared the pasteboard,
+	// the string type belongs to that copy and must not be taken over.
+	// The clip is dropped, and so are the contents saved for -restore.
+	if (pb.changeCount != self.changeCount) {
+	    [NSObject cancelPreviousPerformRequestsWithTarget:self];
+	    [self wipeClip];
+	    self.saved = nil;
+	    return;
+	}
+	CLIPSSH_TRACE(BECOME_OWNER, self.length);
+	self.promisedAt = ClipsshNow();
+	// This does not increment the changeCount!
+	[pb addTypes:stringTypes owner:self];
+    }
 }
 
 #pragma clang diagnostic pop
@@ -78,41 +429,121 @@
 
 static pasteboardOwner *owner = nil;
 
+// Wipe the clip and release our owner object when Tcl exits.
+
+static void releasePasteboardOwner(
+    void *clientData)
+{
+    @autoreleasepool {
+	[NSObject cancelPreviousPerformRequestsWithTarget:owner];
+	[owner release];
+	owner = nil;
+	[stringTypes release];
+	stringTypes = nil;
+    }
+}
+
 void initPasteboard() {
-    NSPasteboard *pb = [NSPasteboard generalPasteboard];
-    // Create our singleton NSPasteboardTypeOwner object.
-    if (owner == nil) {
-	owner = [[pasteboardOwner alloc] init];
-	[owner retain];
-	// This clears the pasteboard, which increments the changeCount.
-	[pb declareTypes:[NSArray arrayWithObject:NSPasteboardTypeString]
-		   owner:nil];
-    }
-}
-
-void addTransientClip(Tk_Window tkwin, const char *clip, NSTimeInterval delay) {    
-    NSPasteboard *pb = [NSPasteboard generalPasteboard];
-    [owner setClip: [[NSString alloc] initWithUTF8String:clip]];
-    [owner setDelay: delay];
-    [owner setTkwin: tkwin];
-
-    // First clear the pasteboard.  (When the clipboard is not empty, the
-    // pasteboard will not ask our owner object to provide its data.)  The
-    // clear operation increments the changeCount, so clipboard managers which
-    // poll the changeCount will also clear their cached copy of the
-    // clipboard.
-
-    [pb clearContents];
-
-    // After a delay, to allow clipboard managers time to notice the clear
-    // operation, make a promise to provide our clip when needed (i.e. on the
-    // next paste).  This does not increment the changeCount, so the clipboard
-    // manager will not notice that we have made the promise, nor will it know
-    // that a paste has been done when it happens..
-
-    [owner performSelector: @selector(becomeOwner) 
-		withObject: nil
-		afterDelay: owner.delay];
+    @autoreleasepool {
+	NSPasteboard *pb = [NSPasteboard generalPasteboard];
+	// Create our singleton NSPasteboardTypeOwner object.
+	if (owner == nil) {
+	    owner = [[pasteboardOwner alloc] init];
+	    stringTypes = [[NSArray alloc]
+			      initWithObjects:NSPasteboardTypeString, nil];
+	    arc4random_buf(sipKey, sizeof(sipKey));
+	    Tcl_CreateExitHandler(releasePasteboardOwner, NULL);
+	    // This clears the pasteboard, which increments the changeCount.
+	    [pb declareTypes:stringTypes owner:nil];
+	}
+    }
+}
+
+// AppKit, and the owner object with it, belong to the main thread.
+
+int isPasteboardThread() {
+    return [NSThread isMainThread];
+}
+
+void addTransientClip(const char *clip, size_t length,
+		      const ClipsshOptions *options, void *clientData) {
+    @autoreleasepool {
+	NSPasteboard *pb = [NSPasteboard generalPasteboard];
+	uint64_t hash = clipHash(clip, length);
+
+	// If the same clip is still pending, and nothing else has been copied
+	// since, its promise, or the clear after its last paste, stays as it
+	// is and only the window is started afresh.  Otherwise forget any
+	// promise or clear still pending from a previous clip.  This also
+	// releases the timers which carry them.
+	BOOL repeat = pb.changeCount == owner.changeCount
+		&& [owner holdsClip: clip length: length hash: hash];
+	if (repeat) {
+	    [NSObject cancelPreviousPerformRequestsWithTarget:owner
+		      selector:@selector(expire) object:nil];
+	} else {
+	    [NSObject cancelPreviousPerformRequestsWithTarget:owner];
+	    [owner setClip: clip length: length hash: hash];
+	}
+	[owner setDelay: options->delay];
+	[owner setPastesLeft: options->count];
+	[owner setWindow: options->window];
+	[owner setWindowOpen: NO];
+	[owner setLinger: options->linger];
+
+	// Save the current contents if asked to restore them later.  If the
+	// pasteboard is still as we left it there is nothing new to save, and
+	// whatever a previous clip saved is kept.  Otherwise something has
+	// been copied since, and that is what must come back, so any older
+	// saved contents are replaced.
+	if (!options->restore) {
+	    [owner setSaved: nil];
+	} else if (pb.changeCount != owner.changeCount) {
+	    savedContents *saved = [[savedContents alloc]
+				       initWithPasteboard: pb];
+	    [owner setSaved: saved];
+	    [saved release];
+	}
+	[owner setClientData: clientData];
+	if (options->command) {
+	    Tcl_IncrRefCount(options->command);
+	}
+	if (owner.command) {
+	    Tcl_DecrRefCount(owner.command);
+	}
+	[owner setCommand: options->command];
+	if (repeat) {
+	    CLIPSSH_TRACE(REFRESH, length);
+	    return;
+	}
+
+	// First clear the pasteboard.  (When the clipboard is not empty, the
+	// pasteboard will not ask our owner object to provide its data.)  The
+	// clear operation increments the changeCount, so clipboard managers
+	// which poll the changeCount will also clear their cached copy of the
+	// clipboard.
+
+	CLIPSSH_TRACE(CLEAR, owner.length);
+	[owner setChangeCount: [pb clearContents]];
+
+	// After a delay, to allow clipboard managers time to notice the clear
+	// operation, make a promise to provide our clip when needed (i.e. on
+	// the next paste).  This does not increment the changeCount, so the
+	// clipboard manager will not notice that we have made the promise,
+	// nor will it know that a paste has been done when it happens..
+
+	[owner performSelector: @selector(becomeOwner) 
+		    withObject: nil
+		    afterDelay: owner.delay];
+    }
+}
+
+// Stop notifying an interpreter which is going away.
+
+void cancelTransientClip(void *clientData) {
+    if (owner.clientData == clientData) {
+	[owner setClientData: NULL];
+    }
 }
 
 /*
@@ -0,0 +1,344 @@
+/*
+ * exec.c --
+ *
+ *	Delivery of a clip directly to the standard input of a process,
+ *	bypassing the clipboard.
+ *
+ * Copyright (C) 2024, Marc Culler, Nathan Dunfield, Matthias Goerner
+ *
+ * This file is part of the Clipssh project.  Clipssh is distributed under the
+ * Tcl license.  The terms of the license are described in the file
+ * "license.terms" which should be included with this distribution.
+ */
+
+#include "clipsshInt.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/*
+ * A clip on its way into a pipe.  The clip is written from its own buffer,
+ * without going through a Tcl channel, and the buffer is wiped as soon as
+ * the pipe has been closed.  Pending deliveries are kept in a list so that
+ * an interpreter which goes away can be forgotten.  File handlers belong to
+ * the thread which created them, so each thread has its own list.
+ */
+
+typedef struct ExecClip {
+    int fd;			/* Write end of the pipe to the process. */
+    char *buffer;		/* The clip. */
+    size_t length;		/* Length of the clip. */
+    size_t written;		/* Number of bytes written so far. */
+    void *clientData;		/* Passed to ClipsshNotifyPaste, or NULL. */
+    Tcl_Obj *command;		/* The -command script, or NULL. */
+    uint64_t spawned;		/* When the process was started. */
+    uint64_t started;		/* When the first write was attempted. */
+    struct ExecClip *nextPtr;	/* Next pending delivery. */
+} ExecClip;
+
+typedef struct ThreadSpecificData {
+    ExecClip *firstExecPtr;	/* Pending deliveries of this thread. */
+} ThreadSpecificData;
+
+static Tcl_ThreadDataKey dataKey;
+
+static void		ExecWritableProc(void *clientData, int mask);
+static void		FinishExecClip(ExecClip *execPtr, int error);
+
+/*
+ *--------------------------------------------------------------
+ *
+ * WipeBuffer --
+ *
+ *	Overwrite a buffer with zeros in a way which the compiler may not
+ *	optimize away.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The buffer is zeroed.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+WipeBuffer(
+    char *buffer,
+    size_t length)
+{
+    volatile char *p = buffer;
+
+    while (length--) {
+	*p++ = 0;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * execClip --
+ *
+ *	Start a process from the command line in cmdObj and write the clip
+ *	to its standard input.  Writing happens from the event loop, so a
+ *	process which reads slowly does not block the application.
+ *
+ * Results:
+ *	A standard Tcl result.  An error is left in the interpreter if the
+ *	process could not be started.
+ *
+ * Side effects:
+ *	A process is started.  When the whole clip has been written the pipe
+ *	is closed, the copy of the clip is wiped and ClipsshNotifyPaste is
+ *	called with clientData.  It is called too, with the error, if the
+ *	process goes away before taking the whole clip.  The process is
+ *	reaped by Tcl.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+execClip(
+    Tcl_Interp *interp,		/* For error reporting. */
+    Tcl_Obj *cmdObj,		/* List of the program and its arguments. */
+    const char *clip,		/* The clip, UTF-8 encoded. */
+    size_t length,		/* Length of the clip in bytes. */
+    const ClipsshOptions *options,
+				/* Only the -command script is used. */
+    void *clientData)		/* Passed to ClipsshNotifyPaste. */
+{
+    Tcl_Size objc, i;
+    Tcl_Obj **objv;
+    const char **argv;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigs;
+    pid_t pid;
+    Tcl_Pid tclPid;
+    int fds[2], code;
+    ExecClip *execPtr;
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+	    Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+    if (Tcl_ListObjGetElements(interp, cmdObj, &objc, &objv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (objc == 0) {
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(
+		"-exec requires a command", -1));
+	return TCL_ERROR;
+    }
+    if (pipe(fds) != 0) {
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"couldn't create pipe: %s", Tcl_PosixError(interp)));
+	return TCL_ERROR;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    argv = (const char **) ckalloc((objc + 1) * sizeof(char *));
+    for (i = 0; i < objc; i++) {
+	argv[i] = Tcl_GetString(objv[i]);
+    }
+    argv[objc] = NULL;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], 0);
+
+    /*
+     * Tcl ignores SIGPIPE, and an ignored signal survives exec.  Start the
+     * process with SIGPIPE at its default and no signals blocked, as Tcl's
+     * own exec does.
+     */
+
+    posix_spawnattr_init(&attr);
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    posix_spawnattr_setflags(&attr,
+	    POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    code = posix_spawnp(&pid, argv[0], &actions, &attr,
+	    (char *const *) argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    if (code != 0) {
+	errno = code;
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"couldn't execute \"%s\": %s", argv[0],
+		Tcl_PosixError(interp)));
+	ckfree(argv);
+	close(fds[1]);
+	return TCL_ERROR;
+    }
+    ckfree(argv);
+    tclPid = (Tcl_Pid) (intptr_t) pid;
+    Tcl_DetachPids(1, &tclPid);
+
+    execPtr = (ExecClip *) ckalloc(sizeof(ExecClip));
+    execPtr->fd = fds[1];
+    execPtr->buffer = (char *) ckalloc(length ? length : 1);
+    memcpy(execPtr->buffer, clip, length);
+    execPtr->length = length;
+    execPtr->written = 0;
+    execPtr->clientData = clientData;
+    execPtr->command = options->command;
+    if (execPtr->command != NULL) {
+	Tcl_IncrRefCount(execPtr->command);
+    }
+    execPtr->spawned = ClipsshNow();
+    execPtr->nextPtr = tsdPtr->firstExecPtr;
+    tsdPtr->firstExecPtr = execPtr;
+    fcntl(execPtr->fd, F_SETFL, O_NONBLOCK);
+    CLIPSSH_TRACE(BECOME_OWNER, length);
+    Tcl_CreateFileHandler(execPtr->fd, TCL_WRITABLE, ExecWritableProc,
+	    execPtr);
+    return TCL_OK;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * ExecWritableProc --
+ *
+ *	File handler which writes as much of the clip as the pipe will take.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The delivery is finished when the clip has been written or writing
+ *	has failed, for example because the process has gone away.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+ExecWritableProc(
+    void *clientData,		/* The ExecClip. */
+    int mask)			/* Not used. */
+{
+    ExecClip *execPtr = (ExecClip *) clientData;
+    ssize_t count;
+
+    if (execPtr->written == 0) {
+	CLIPSSH_TRACE(PROVIDE, execPtr->length);
+	execPtr->started = ClipsshNow();
+    }
+    while (execPtr->written < execPtr->length) {
+	count = write(execPtr->fd, execPtr->buffer + execPtr->written,
+		execPtr->length - execPtr->written);
+	if (count < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    if (errno == EAGAIN) {
+		return;
+	    }
+	    FinishExecClip(execPtr, errno);
+	    return;
+	}
+	execPtr->written += count;
+    }
+    FinishExecClip(execPtr, 0);
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * FinishExecClip --
+ *
+ *	Close the pipe and discard the clip.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The clip is wiped and freed.  The interpreter is notified as for a
+ *	paste, or of the error if the clip could not be delivered in full.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+FinishExecClip(
+    ExecClip *execPtr,
+    int error)			/* The errno value of a failed write, or 0 if
+				 * the clip was fully written. */
+{
+    ExecClip **linkPtr;
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+	    Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+    Tcl_DeleteFileHandler(execPtr->fd);
+    close(execPtr->fd);
+    CLIPSSH_TRACE(DELAYED_CLEAR, execPtr->length);
+    WipeBuffer(execPtr->buffer, execPtr->length);
+    for (linkPtr = &tsdPtr->firstExecPtr; *linkPtr != execPtr;
+	    linkPtr = &(*linkPtr)->nextPtr) {
+	/* Empty loop body. */
+    }
+    *linkPtr = execPtr->nextPtr;
+    if (execPtr->clientData) {
+	ClipsshPasteInfo info;
+
+	info.length = execPtr->length;
+	info.error = error;
+	info.latency = execPtr->started - execPtr->spawned;
+	info.transfer = ClipsshNow() - execPtr->started;
+	ClipsshNotifyPaste(execPtr->clientData, execPtr->command, &info);
+    }
+    if (execPtr->command != NULL) {
+	Tcl_DecrRefCount(execPtr->command);
+    }
+    ckfree(execPtr->buffer);
+    ckfree(execPtr);
+    Tcl_ReapDetachedProcs();
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * cancelExecClip --
+ *
+ *	Stop notifying an interpreter which is going away.  Its pending
+ *	deliveries are still completed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *--------------------------------------------------------------
+ */
+
+void
+cancelExecClip(
+    void *clientData)
+{
+    ExecClip *execPtr;
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+	    Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+
+    for (execPtr = tsdPtr->firstExecPtr; execPtr;
+	    execPtr = execPtr->nextPtr) {
+	if (execPtr->clientData == clientData) {
+	    execPtr->clientData = NULL;
+	}
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * End:
+ */